@@ -0,0 +1,519 @@
+//
+// Bounded DNS record cache backed by the slab allocator
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+
+static size_t round_down_pow2(size_t n) {
+    size_t p = 1;
+    while (p <= n / 2)
+        p <<= 1;
+    return p;
+}
+
+/**
+ * Initializes an empty cache
+ *
+ * The hash table, ghost table, and page reference counts are sized from
+ * the budget and their memory is subtracted from it, the remainder is
+ * the slab limit.
+ *
+ * @param cache cache to initialize
+ * @param budget total bytes the cache may use
+ * @return 0 on success, -1 if the budget is too small or allocation fails
+ */
+int cache_init(struct cache *cache, size_t budget) {
+    memset(cache, 0, sizeof(struct cache));
+    size_t buckets = budget / CACHE_BYTES_PER_BUCKET;
+    buckets = round_down_pow2(buckets < CACHE_MIN_BUCKETS ? CACHE_MIN_BUCKETS : buckets);
+    size_t metadata = buckets * (sizeof(struct cache_entry *) + sizeof(struct cache_ghost)) +
+                      budget / SLAB_PAGE_SIZE * sizeof(uint16_t);
+    if (budget < metadata + SLAB_PAGE_SIZE) {
+        fprintf(stderr, "Cache budget of %zu bytes is too small\n", budget);
+        return -1;
+    }
+
+    cache->buckets = calloc(buckets, sizeof(struct cache_entry *));
+    cache->ghosts = calloc(buckets, sizeof(struct cache_ghost));
+    cache->page_refs = calloc(budget / SLAB_PAGE_SIZE, sizeof(uint16_t));
+    if (cache->buckets == NULL || cache->ghosts == NULL || cache->page_refs == NULL ||
+        slab_init(&cache->slab, budget - metadata) != 0) {
+        free(cache->buckets);
+        free(cache->ghosts);
+        free(cache->page_refs);
+        return -1;
+    }
+    cache->bucket_mask = buckets - 1;
+    cache->ghost_mask = buckets - 1;
+    return 0;
+}
+
+/**
+ * Frees every entry and the cache tables
+ *
+ * @param cache
+ */
+void cache_destroy(struct cache *cache) {
+    slab_destroy(&cache->slab);
+    free(cache->buckets);
+    free(cache->ghosts);
+    free(cache->page_refs);
+    memset(cache, 0, sizeof(struct cache));
+}
+
+static uint8_t ascii_lower(uint8_t c) {
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+/**
+ * FNV-1a hash of the case folded name, type, and class
+ *
+ * Label length octets are at most 63 and are never folded.
+ */
+static uint64_t cache_hash(const char *name, size_t name_len, uint16_t type, uint16_t class) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < name_len; i++) {
+        hash ^= ascii_lower((uint8_t) name[i]);
+        hash *= 0x100000001B3ULL;
+    }
+    uint8_t tail[] = {type >> 8, type & 0xFF, class >> 8, class & 0xFF};
+    for (size_t i = 0; i < sizeof(tail); i++) {
+        hash ^= tail[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash == 0 ? 1 : hash;  // 0 marks an empty ghost slot
+}
+
+static int cache_key_equals(const struct cache_entry *entry, uint64_t hash, const char *name, size_t name_len,
+                            uint16_t type, uint16_t class) {
+    if (entry->hash != hash || entry->type != type || entry->class != class || entry->name_len != name_len)
+        return 0;
+    for (size_t i = 0; i < name_len; i++) {
+        if (ascii_lower((uint8_t) entry->data[i]) != ascii_lower((uint8_t) name[i]))
+            return 0;
+    }
+    return 1;
+}
+
+static struct cache_entry **cache_bucket(struct cache *cache, uint64_t hash) {
+    return &cache->buckets[hash & cache->bucket_mask];
+}
+
+static struct cache_queue *cache_queue_of(struct cache *cache, const struct cache_entry *entry) {
+    struct cache_class *class = &cache->classes[entry->class_id];
+    return entry->queue == CACHE_QUEUE_MAIN ? &class->main : &class->small;
+}
+
+static size_t cache_chunk_size(const struct cache *cache, const struct cache_entry *entry) {
+    return cache->slab.classes[entry->class_id].chunk_size;
+}
+
+/**
+ * Links an entry at the head of its queue and stamps it with the insertion clock
+ */
+static void queue_push(struct cache *cache, struct cache_entry *entry) {
+    struct cache_queue *queue = cache_queue_of(cache, entry);
+    size_t bytes = cache_chunk_size(cache, entry);
+    entry->seq = ++cache->seq;
+    entry->prev = NULL;
+    entry->next = queue->head;
+    if (queue->head != NULL)
+        queue->head->prev = entry;
+    else
+        queue->tail = entry;
+    queue->head = entry;
+    queue->bytes += bytes;
+    queue->count++;
+    cache->bytes[entry->queue] += bytes;
+    cache->counts[entry->queue]++;
+}
+
+static void queue_remove(struct cache *cache, struct cache_entry *entry) {
+    struct cache_queue *queue = cache_queue_of(cache, entry);
+    size_t bytes = cache_chunk_size(cache, entry);
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        queue->head = entry->next;
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        queue->tail = entry->prev;
+    entry->prev = NULL;
+    entry->next = NULL;
+    queue->bytes -= bytes;
+    queue->count--;
+    cache->bytes[entry->queue] -= bytes;
+    cache->counts[entry->queue]--;
+}
+
+static void ghost_insert(struct cache *cache, uint64_t hash) {
+    struct cache_ghost *ghost = &cache->ghosts[hash & cache->ghost_mask];
+    ghost->hash = hash;
+    ghost->seq = ++cache->ghost_seq;
+}
+
+/**
+ * Checks whether a key was recently evicted from a small FIFO
+ *
+ * The ghost FIFO remembers as many keys as the main FIFOs hold entries,
+ * plus CACHE_MIN_BUCKETS so keys are remembered while they are empty.
+ */
+static int ghost_contains(const struct cache *cache, uint64_t hash) {
+    const struct cache_ghost *ghost = &cache->ghosts[hash & cache->ghost_mask];
+    return ghost->hash == hash &&
+           cache->ghost_seq - ghost->seq < cache->counts[CACHE_QUEUE_MAIN] + CACHE_MIN_BUCKETS;
+}
+
+/**
+ * Sets the hit count of an entry, keeping its page's reference count current
+ */
+static void cache_set_freq(struct cache *cache, struct cache_entry *entry, uint8_t freq) {
+    uint16_t *refs = &cache->page_refs[slab_page_index(&cache->slab, entry)];
+    if (entry->freq == 0 && freq > 0)
+        (*refs)++;
+    else if (entry->freq > 0 && freq == 0)
+        (*refs)--;
+    entry->freq = freq;
+}
+
+/**
+ * Unlinks an entry from its hash bucket and queue and frees its chunk
+ */
+static void cache_remove(struct cache *cache, struct cache_entry *entry) {
+    struct cache_entry **link = cache_bucket(cache, entry->hash);
+    while (*link != entry)
+        link = &(*link)->hash_next;
+    *link = entry->hash_next;
+    queue_remove(cache, entry);
+    cache_set_freq(cache, entry, 0);
+    slab_free(&cache->slab, entry);
+}
+
+/**
+ * Evicts an entry, remembering it as a ghost if it was never hit
+ */
+static void cache_evict(struct cache *cache, struct cache_entry *entry) {
+    if (entry->queue == CACHE_QUEUE_SMALL)
+        ghost_insert(cache, entry->hash);
+    cache_remove(cache, entry);
+    cache->evictions++;
+}
+
+/**
+ * Checks whether the small FIFOs hold at least CACHE_SMALL_PERCENT of all chunk bytes
+ */
+static int cache_small_over(const struct cache *cache) {
+    size_t total = cache->bytes[CACHE_QUEUE_SMALL] + cache->bytes[CACHE_QUEUE_MAIN];
+    return cache->bytes[CACHE_QUEUE_SMALL] * 100 >= total * CACHE_SMALL_PERCENT;
+}
+
+/**
+ * Finds the next S3-FIFO victim of a size class without evicting it
+ *
+ * The class evicts from its small FIFO while the small FIFOs of all
+ * classes are over their share, or when its main FIFO is empty. Entries
+ * hit while in the small FIFO are promoted to the main FIFO and entries
+ * in the main FIFO with hits left are reinserted with one hit less,
+ * until the queue being evicted from has an unreferenced tail. Only the
+ * queues of this class are modified.
+ *
+ * @return next victim, or NULL if the class holds no entries
+ */
+static struct cache_entry *cache_victim(struct cache *cache, struct cache_class *class) {
+    int small_over = cache_small_over(cache);
+    while (1) {
+        struct cache_entry *entry;
+        if (class->small.tail != NULL && (small_over || class->main.tail == NULL)) {
+            entry = class->small.tail;
+            if (entry->freq == 0)
+                return entry;
+            queue_remove(cache, entry);
+            cache_set_freq(cache, entry, 0);
+            entry->queue = CACHE_QUEUE_MAIN;
+            queue_push(cache, entry);
+        } else if ((entry = class->main.tail) != NULL) {
+            if (entry->freq == 0)
+                return entry;
+            queue_remove(cache, entry);
+            cache_set_freq(cache, entry, entry->freq - 1);
+            queue_push(cache, entry);
+        } else {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * Finds a page of another size class that could move to class_id
+ *
+ * Candidates are the pages of the last CACHE_REASSIGN_SCAN entries of
+ * every other class's small and main FIFO. Pages without referenced
+ * entries are preferred, then older entries. Queues are only read.
+ *
+ * @param cache
+ * @param class_id class that needs a page
+ * @param min_age only consider entries that entered their queue more than min_age insertions ago
+ * @param cold_only only consider pages without referenced entries
+ * @return entry on the chosen page, or NULL if there is no candidate
+ */
+static struct cache_entry *cache_donor(struct cache *cache, size_t class_id, uint64_t min_age, int cold_only) {
+    struct cache_entry *best = NULL;
+    int best_cold = 0;
+    for (size_t i = 0; i < cache->slab.num_classes; i++) {
+        if (i == class_id)
+            continue;
+        struct cache_queue *queues[] = {&cache->classes[i].small, &cache->classes[i].main};
+        for (size_t j = 0; j < sizeof(queues) / sizeof(queues[0]); j++) {
+            struct cache_entry *entry = queues[j]->tail;
+            for (size_t k = 0; entry != NULL && k < CACHE_REASSIGN_SCAN; k++, entry = entry->prev) {
+                if (cache->seq - entry->seq <= min_age)
+                    break;
+                int cold = cache->page_refs[slab_page_index(&cache->slab, entry)] == 0;
+                if (cold_only && !cold)
+                    continue;
+                if (best == NULL || cold > best_cold || (cold == best_cold && entry->seq < best->seq)) {
+                    best = entry;
+                    best_cold = cold;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+/**
+ * Evicts every entry sharing a page with victim, releasing the page
+ *
+ * Entries are remembered as ghosts unless they sit unreferenced in a
+ * main FIFO, so referenced entries taken with the page return straight
+ * to the main FIFO when they are inserted again.
+ */
+static void cache_reassign(struct cache *cache, struct cache_entry *victim) {
+    void *chunks[SLAB_MAX_PAGE_CHUNKS];
+    size_t count = slab_page_chunks(&cache->slab, victim, chunks);
+    for (size_t i = 0; i < count; i++) {
+        struct cache_entry *entry = chunks[i];
+        if (entry->queue == CACHE_QUEUE_MAIN && entry->freq > 0)
+            ghost_insert(cache, entry->hash);
+        cache_evict(cache, entry);
+    }
+    cache->reassigns++;
+}
+
+/**
+ * Allocates a chunk, evicting entries until it fits in the budget
+ *
+ * The requesting class evicts its own S3-FIFO victim, unless another
+ * class holds a cold page that is CACHE_REASSIGN_AGE_RATIO times older,
+ * or any cold page while the own victim would come from a main FIFO
+ * although the small FIFOs are over their share. Then every entry on
+ * that page is evicted and the page moves to the requesting class. A
+ * class with nothing to evict takes the best page of any other class.
+ * One allocation evicts at most one page of entries however fragmented
+ * the pages are, and hot entries of one class are not traded for the
+ * one-hit entries of another.
+ */
+static struct cache_entry *cache_alloc(struct cache *cache, size_t size) {
+    size_t class_id = slab_class_id(&cache->slab, size);
+    if (class_id >= cache->slab.num_classes)
+        return NULL;
+    struct cache_entry *entry;
+    while ((entry = slab_alloc(&cache->slab, size)) == NULL) {
+        if (cache->slab.used + SLAB_PAGE_SIZE <= cache->slab.limit)
+            return NULL;  // there was room for a page, the system is out of memory
+
+        struct cache_entry *own = cache_victim(cache, &cache->classes[class_id]);
+        struct cache_entry *donor;
+        if (own == NULL) {
+            donor = cache_donor(cache, class_id, 0, 0);
+        } else {
+            uint64_t min_age = (cache->seq - own->seq) * CACHE_REASSIGN_AGE_RATIO;
+            if (own->queue == CACHE_QUEUE_MAIN && cache_small_over(cache))
+                min_age = 0;
+            donor = cache_donor(cache, class_id, min_age, 1);
+        }
+        if (donor != NULL)
+            cache_reassign(cache, donor);
+        else if (own != NULL)
+            cache_evict(cache, own);
+        else
+            return NULL;
+    }
+    entry->class_id = (uint8_t) class_id;
+    return entry;
+}
+
+static struct cache_entry *cache_find(struct cache *cache, uint64_t hash, const char *name, size_t name_len,
+                                      uint16_t type, uint16_t class) {
+    struct cache_entry *entry = *cache_bucket(cache, hash);
+    while (entry != NULL && !cache_key_equals(entry, hash, name, name_len, type, class))
+        entry = entry->hash_next;
+    return entry;
+}
+
+/**
+ * TTL a record is cached for
+ *
+ * TTLs with the most significant bit set are treated as 0, as RFC 2181
+ * section 8 requires, and the rest are capped at CACHE_MAX_TTL.
+ */
+static uint32_t cache_ttl(uint32_t ttl) {
+    if (ttl & 0x80000000)
+        return 0;
+    return ttl > CACHE_MAX_TTL ? CACHE_MAX_TTL : ttl;
+}
+
+static int resource_key_equals(const struct resource *a, const struct resource *b) {
+    if (a->type != b->type || a->class != b->class || a->name_len != b->name_len)
+        return 0;
+    for (size_t i = 0; i < a->name_len; i++) {
+        if (ascii_lower((uint8_t) a->name[i]) != ascii_lower((uint8_t) b->name[i]))
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * Caches the RRset for a name, type, and class, replacing any cached one
+ *
+ * The records must all come from one response and share a name, type,
+ * and class, and each must hold an uncompressed owner name and rdata,
+ * as returned by get_resource. A replaced RRset passes its queue and hit
+ * count on to the new one. The RRset expires with its shortest TTL, an
+ * RRset with a TTL of 0 is not cached.
+ *
+ * @param cache
+ * @param rrset records of the RRset
+ * @param count number of records, at least one
+ * @param now current time
+ * @return 0 on success, -1 if the records do not form an RRset, do not fit
+ * in a slab chunk, or no chunk can be allocated. Any previously cached
+ * RRset for the key is dropped either way.
+ */
+int cache_insert(struct cache *cache, const struct resource *const *rrset, size_t count, time_t now) {
+    if (count == 0)
+        return -1;
+    const struct resource *first = rrset[0];
+    uint64_t hash = cache_hash(first->name, first->name_len, first->type, first->class);
+    struct cache_entry *old = cache_find(cache, hash, first->name, first->name_len, first->type, first->class);
+    uint8_t queue = CACHE_QUEUE_SMALL;
+    uint8_t freq = 0;
+    int replaced = 0;
+    if (old != NULL) {
+        if (old->expires > now) {
+            replaced = 1;
+            queue = old->queue;
+            freq = old->freq;
+        }
+        cache_remove(cache, old);
+    }
+
+    size_t rdata_len = 0;
+    uint32_t ttl = CACHE_MAX_TTL;
+    for (size_t i = 0; i < count; i++) {
+        if (!resource_key_equals(rrset[i], first))
+            return -1;
+        rdata_len += (size_t) rrset[i]->rdlength + 2;
+        if (cache_ttl(rrset[i]->ttl) < ttl)
+            ttl = cache_ttl(rrset[i]->ttl);
+    }
+    if (ttl == 0)
+        return 0;
+    size_t size = sizeof(struct cache_entry) + first->name_len + rdata_len;
+    if (count > UINT16_MAX || size > SLAB_MAX_CHUNK_SIZE)
+        return -1;
+
+    struct cache_entry *entry = cache_alloc(cache, size);
+    if (entry == NULL)
+        return -1;
+    uint8_t class_id = entry->class_id;
+    memset(entry, 0, sizeof(struct cache_entry));
+    entry->class_id = class_id;
+    entry->hash = hash;
+    entry->expires = now + ttl;
+    entry->type = first->type;
+    entry->class = first->class;
+    entry->name_len = (uint16_t) first->name_len;
+    entry->rdata_len = (uint16_t) rdata_len;
+    entry->rr_count = (uint16_t) count;
+    memcpy(entry->data, first->name, first->name_len);
+    char *rr = entry->data + entry->name_len;
+    for (size_t i = 0; i < count; i++) {
+        rr[0] = (char) (rrset[i]->rdlength >> 8);
+        rr[1] = (char) (rrset[i]->rdlength & 0xFF);
+        memcpy(rr + 2, rrset[i]->rdata, rrset[i]->rdlength);
+        rr += 2 + rrset[i]->rdlength;
+    }
+
+    if (!replaced) {
+        if (ghost_contains(cache, hash)) {
+            queue = CACHE_QUEUE_MAIN;
+            cache->ghost_hits++;
+        }
+        cache->inserts++;
+    }
+    entry->queue = queue;
+    cache_set_freq(cache, entry, freq);
+    struct cache_entry **bucket = cache_bucket(cache, hash);
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    queue_push(cache, entry);
+    return 0;
+}
+
+/**
+ * Looks up the cached RRset for a name, type, and class
+ *
+ * @param cache
+ * @param name wire format owner name
+ * @param name_len length of name including the terminating null label
+ * @param type record type
+ * @param class record class
+ * @param now current time
+ * @return cached RRset, valid until the next insert, or NULL on a miss
+ */
+const struct cache_entry *cache_lookup(struct cache *cache, const char *name, size_t name_len, uint16_t type,
+                                       uint16_t class, time_t now) {
+    uint64_t hash = cache_hash(name, name_len, type, class);
+    struct cache_entry *entry = cache_find(cache, hash, name, name_len, type, class);
+    if (entry != NULL && entry->expires <= now) {
+        cache_remove(cache, entry);
+        entry = NULL;
+    }
+    if (entry == NULL) {
+        cache->misses++;
+        return NULL;
+    }
+    if (entry->freq < CACHE_MAX_FREQ)
+        cache_set_freq(cache, entry, entry->freq + 1);
+    cache->hits++;
+    return entry;
+}
+
+/**
+ * Print cache statistics
+ *
+ * @param cache
+ */
+void print_cache(const struct cache *cache) {
+    printf("Cache: {\n"
+           "  small: %zu entries, %zu bytes,\n"
+           "  main: %zu entries, %zu bytes,\n"
+           "  hits: %llu,\n"
+           "  misses: %llu,\n"
+           "  inserts: %llu,\n"
+           "  evictions: %llu,\n"
+           "  ghost_hits: %llu,\n"
+           "  reassigns: %llu\n"
+           "}\n",
+           cache->counts[CACHE_QUEUE_SMALL], cache->bytes[CACHE_QUEUE_SMALL], cache->counts[CACHE_QUEUE_MAIN],
+           cache->bytes[CACHE_QUEUE_MAIN],
+           (unsigned long long) cache->hits, (unsigned long long) cache->misses,
+           (unsigned long long) cache->inserts, (unsigned long long) cache->evictions,
+           (unsigned long long) cache->ghost_hits, (unsigned long long) cache->reassigns);
+    print_slab(&cache->slab);
+}
@@ -0,0 +1,133 @@
+//
+// Bounded DNS record cache backed by the slab allocator
+//
+
+#ifndef PALANTIR_CACHE_H
+#define PALANTIR_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "dns.h"
+#include "slab.h"
+
+#define CACHE_BYTES_PER_BUCKET 256  // expected chunk bytes per hash bucket
+#define CACHE_MIN_BUCKETS 64
+#define CACHE_SMALL_PERCENT 10  // share of all chunk bytes the small FIFOs may hold before main FIFOs are spared
+#define CACHE_MAX_FREQ 3
+#define CACHE_MAX_TTL 86400  // seconds, longer TTLs are shortened to this
+#define CACHE_REASSIGN_AGE_RATIO 2  // how much older another class's cold page must be to take it
+#define CACHE_REASSIGN_SCAN 8  // entries examined at the tail of each queue when looking for a page to take
+
+#define CACHE_QUEUE_SMALL 0
+#define CACHE_QUEUE_MAIN 1
+
+/**
+ * Cached RRset, all records sharing a name, type, and class
+ *
+ * The entry, its owner name, and its records are packed into a single
+ * slab chunk. data holds the wire format name (name_len bytes) followed
+ * by rr_count records, each a 16 bit big endian rdlength and its rdata.
+ */
+struct cache_entry {
+    struct cache_entry *hash_next;
+    struct cache_entry *prev;  // towards the head (newest) of the queue
+    struct cache_entry *next;  // towards the tail (oldest) of the queue
+    uint64_t hash;
+    uint64_t seq;  // value of cache->seq when the entry last entered a queue
+    time_t expires;
+    uint16_t type;
+    uint16_t class;
+    uint16_t name_len;
+    uint16_t rdata_len;  // bytes of data following the name
+    uint16_t rr_count;
+    uint8_t freq;  // hits since insertion or last demotion, capped at CACHE_MAX_FREQ
+    uint8_t queue;  // CACHE_QUEUE_SMALL or CACHE_QUEUE_MAIN
+    uint8_t class_id;  // slab size class of the chunk holding the entry
+    char data[];
+};
+
+struct cache_queue {
+    struct cache_entry *head;
+    struct cache_entry *tail;
+    size_t bytes;  // chunk bytes held by entries in the queue
+    size_t count;
+};
+
+/**
+ * Small and main FIFO of one slab size class
+ *
+ * Keeping queues per class means the next victim always frees a chunk
+ * of a known size class, so eviction never has to hunt for a full page.
+ */
+struct cache_class {
+    struct cache_queue small;
+    struct cache_queue main;
+};
+
+/**
+ * Recently evicted key hash
+ *
+ * A hash is a ghost while fewer than counts[CACHE_QUEUE_MAIN] + CACHE_MIN_BUCKETS
+ * ghosts were recorded after it. Slots are overwritten on collision,
+ * ghosts are only a hint.
+ */
+struct cache_ghost {
+    uint64_t hash;
+    uint64_t seq;
+};
+
+/**
+ * S3-FIFO record cache
+ * @see https://dl.acm.org/doi/10.1145/3600006.3613147
+ *
+ * New keys enter the small FIFO. Entries evicted from the small FIFO
+ * without being hit again are remembered only as ghosts, so one-hit
+ * names (e.g. random subdomain floods) never reach the main FIFO and
+ * cannot push out the working set. Keys that are hit while in the small
+ * FIFO, or that are re-inserted while still a ghost, go to the main
+ * FIFO, which is evicted CLOCK style.
+ *
+ * Each slab size class runs its own pair of FIFOs, but whether the
+ * small or the main FIFO is evicted from is decided over all classes,
+ * so a flood confined to one class cannot make another class give up
+ * its main FIFO. When an allocation needs room the requesting class
+ * evicts its own victim, unless another class holds a cold page (no
+ * entry on it was hit since entering or last aging in its queue) that
+ * is much older, or the requesting class would otherwise evict from
+ * its main FIFO while small FIFOs are over their share. Then every
+ * entry on that page is evicted and the page moves to the requesting
+ * class. Only a class with nothing left to evict takes a page holding
+ * referenced entries. Either way
+ * a single insert evicts at most one page worth of entries.
+ */
+struct cache {
+    struct slab slab;
+    struct cache_entry **buckets;
+    size_t bucket_mask;
+    struct cache_ghost *ghosts;
+    size_t ghost_mask;
+    uint64_t ghost_seq;
+    uint64_t seq;
+    uint16_t *page_refs;  // entries with freq above 0 per slab page, indexed by slab_page_index
+    struct cache_class classes[SLAB_MAX_CLASSES];
+    size_t counts[2];  // entries per queue kind, indexed by CACHE_QUEUE_SMALL and CACHE_QUEUE_MAIN
+    size_t bytes[2];  // chunk bytes per queue kind
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+    uint64_t ghost_hits;
+    uint64_t reassigns;  // pages moved between size classes
+};
+
+int cache_init(struct cache *cache, size_t budget);
+void cache_destroy(struct cache *cache);
+
+int cache_insert(struct cache *cache, const struct resource *const *rrset, size_t count, time_t now);
+const struct cache_entry *cache_lookup(struct cache *cache, const char *name, size_t name_len, uint16_t type,
+                                       uint16_t class, time_t now);
+
+void print_cache(const struct cache *cache);
+
+#endif //PALANTIR_CACHE_H
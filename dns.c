@@ -3,8 +3,10 @@
 //
 
 #include <printf.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <arpa/inet.h>
 #include "dns.h"
 
 /**
@@ -135,35 +137,174 @@ void print_question(struct question *question) {
 }
 
 /**
- * Extracts (deserializes) DNS resource record from a buffer
+ * Reads a big endian 16 bit field, buffer need not be aligned
+ */
+static uint16_t read_u16(const char *buffer) {
+    return (uint16_t) ((uint8_t) buffer[0] << 8 | (uint8_t) buffer[1]);
+}
+
+/**
+ * Reads a big endian 32 bit field, buffer need not be aligned
+ */
+static uint32_t read_u32(const char *buffer) {
+    return (uint32_t) read_u16(buffer) << 16 | read_u16(buffer + 2);
+}
+
+/**
+ * Decodes a possibly compressed domain name into uncompressed wire format
+ *
+ * A compression pointer (two octets starting with 11) refers to an
+ * earlier offset in the message. Pointers are followed so the decoded
+ * name stays meaningful once the message is freed. Each pointer must
+ * point before the previous one, which rules out loops.
+ *
+ * @param message full DNS message
+ * @param size of message
+ * @param offset offset of the name within message
+ * @param out buffer of at least DNS_MAX_NAME_SIZE bytes
+ * @param out_len set to the length of the decoded name including the null label
+ * @return number of bytes the name occupies at offset, or 0 if malformed
+ */
+size_t get_wire_name(const char *message, size_t size, size_t offset, char *out, size_t *out_len) {
+    size_t consumed = 0;
+    size_t len = 0;
+    size_t pos = offset;
+    size_t limit = offset;
+    while (1) {
+        if (pos >= size)
+            return 0;
+        uint8_t label = (uint8_t) message[pos];
+        if ((label & 0xC0) == 0xC0) {
+            if (pos + 1 >= size)
+                return 0;
+            size_t target = (size_t) (label & 0x3F) << 8 | (uint8_t) message[pos + 1];
+            if (target >= limit)
+                return 0;
+            if (consumed == 0)
+                consumed = pos + 2 - offset;
+            pos = limit = target;
+            continue;
+        }
+        if ((label & 0xC0) != 0 || pos + 1 + label > size || len + 1 + label > DNS_MAX_NAME_SIZE)
+            return 0;
+        memcpy(out + len, message + pos, 1 + label);
+        len += 1 + label;
+        pos += 1 + label;
+        if (label == 0)
+            break;
+    }
+    if (consumed == 0)
+        consumed = pos - offset;
+    *out_len = len;
+    return consumed;
+}
+
+/**
+ * Copies rdata, decompressing any domain names it contains
+ *
+ * @param message full DNS message
+ * @param offset offset of the rdata within message
+ * @param rdlength length of the rdata in the message
+ * @param type record type, selects which fields are names
+ * @param out buffer of at least rdlength + 2 * DNS_MAX_NAME_SIZE bytes
+ * @param out_len set to the length of the decoded rdata
+ * @return 0 on success, -1 if malformed
+ */
+static int get_rdata(const char *message, size_t offset, uint16_t rdlength, uint16_t type, char *out,
+                     size_t *out_len) {
+    size_t prefix = 0;  // octets preceding the first name
+    size_t names = 0;
+    switch (type) {
+        case 2:  // NS
+        case 3:  // MD
+        case 4:  // MF
+        case 5:  // CNAME
+        case 7:  // MB
+        case 8:  // MG
+        case 9:  // MR
+        case 12:  // PTR
+            names = 1;
+            break;
+        case 6:  // SOA, followed by 20 octets of serial and timers
+        case 14:  // MINFO
+            names = 2;
+            break;
+        case 15:  // MX, preference precedes the exchange
+            prefix = 2;
+            names = 1;
+            break;
+        default:
+            break;
+    }
+    size_t end = offset + rdlength;
+    if (prefix > rdlength)
+        return -1;
+    memcpy(out, message + offset, prefix);
+    size_t pos = offset + prefix;
+    size_t len = prefix;
+    for (size_t i = 0; i < names; i++) {
+        size_t name_len;
+        size_t consumed = get_wire_name(message, end, pos, out + len, &name_len);
+        if (consumed == 0)
+            return -1;
+        pos += consumed;
+        len += name_len;
+    }
+    memcpy(out + len, message + pos, end - pos);
+    *out_len = len + end - pos;
+    return 0;
+}
+
+/**
+ * Extracts (deserializes) DNS resource record from a message
  *
  * DNS Resource Records (RR) are used for answer, authority, and
- * additional record sections for all DNS messages.
+ * additional record sections for all DNS messages. The owner name and
+ * any names in the rdata are decompressed, so the record does not
+ * reference the message.
  *
- * @param buffer UDP DNS message
- * @param size of buffer
- * @return pointer to heap allocated question
+ * @param message UDP DNS message
+ * @param size of message
+ * @param offset offset of the record, advanced past it on success
+ * @param records slab the resource is allocated from, release it with slab_free
+ * @return resource sharing one slab chunk with its name and rdata, or NULL if malformed or the slab is full
  */
-struct resource *get_resource(const char *buffer, size_t size) {
-    if (size < 11) {
+struct resource *get_resource(const char *message, size_t size, size_t *offset, struct slab *records) {
+    char name[DNS_MAX_NAME_SIZE];
+    size_t name_len;
+    size_t consumed = get_wire_name(message, size, *offset, name, &name_len);
+    if (consumed == 0 || *offset + consumed + 10 > size) {
         printf("Error: malformed resource\n");
-        exit(1);
+        return NULL;
     }
-    struct resource *resource = malloc(sizeof(struct resource));
-    resource->name = buffer;
-    size_t name_len = strlen(buffer) + 1;
-    resource->name_len = name_len;
-    resource->type = htons(*(uint16_t *) buffer + name_len);
-    resource->class = htons(*(uint16_t *) buffer + name_len + 2);
-    resource->ttl = htonl(*(uint32_t *) buffer + name_len + 4);
-    resource->rdlength = htons(*(uint16_t *) buffer + name_len + 8);
-    if (resource->rdlength < 8) {
-        fprintf(stderr, "rdata too large, over 8 bytes");
-        exit(EXIT_FAILURE);
+    const char *fields = message + *offset + consumed;
+    uint16_t type = read_u16(fields);
+    uint16_t rdlength = read_u16(fields + 8);
+    size_t rdata_offset = *offset + consumed + 10;
+    char rdata[DNS_MAX_UDP_SIZE + 2 * DNS_MAX_NAME_SIZE];
+    size_t rdata_len;
+    if (rdlength > DNS_MAX_UDP_SIZE || rdata_offset + rdlength > size ||
+        get_rdata(message, rdata_offset, rdlength, type, rdata, &rdata_len) != 0) {
+        printf("Error: malformed resource\n");
+        return NULL;
+    }
+
+    struct resource *resource = slab_alloc(records, sizeof(struct resource) + name_len + rdata_len);
+    if (resource == NULL) {
+        printf("Error: no memory for resource\n");
+        return NULL;
     }
-    resource->rdata = malloc(resource->rdlength);
-    memset(resource->rdata, 0, resource->rdlength);
-    memcpy(resource->rdata, buffer + name_len + 10, resource->rdlength);
+    char *data = (char *) (resource + 1);
+    memcpy(data, name, name_len);
+    memcpy(data + name_len, rdata, rdata_len);
+    resource->name = data;
+    resource->name_len = name_len;
+    resource->type = type;
+    resource->class = read_u16(fields + 2);
+    resource->ttl = read_u32(fields + 4);
+    resource->rdlength = (uint16_t) rdata_len;
+    resource->rdata = data + name_len;
+    *offset = rdata_offset + rdlength;
     return resource;
 }
 
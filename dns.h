@@ -5,7 +5,9 @@
 #ifndef PALANTIR_DNS_H
 #define PALANTIR_DNS_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include "slab.h"
 
 #define DNS_MAX_UDP_SIZE 512
 #define DNS_MAX_LABEL_SIZE 63
@@ -143,7 +145,8 @@ char *get_type(uint16_t type);
 
 struct header *get_header(const char *buffer, size_t size);
 struct question *get_question(const char *buffer, size_t size);
-struct resource *get_resource(const char *buffer, size_t size);
+struct resource *get_resource(const char *message, size_t size, size_t *offset, struct slab *records);
+size_t get_wire_name(const char *message, size_t size, size_t offset, char *out, size_t *out_len);
 
 void print_header(struct header *header);
 void print_question(struct question *question);
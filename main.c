@@ -4,19 +4,22 @@
 #include <stdlib.h>
 #include <errno.h>
 #include "dns.h"
+#include "slab.h"
 
 
 #define MAX_QUESTIONS 10
 #define MAX_ADDITIONAL_RECORDS 10
 #define MAX_ANSWERS_RECORDS 10
 #define MAX_AUTHORITIES_RECORDS 10
+// Every record could need a page of its own size class
+#define RECORD_SLAB_SIZE ((MAX_ANSWERS_RECORDS + MAX_AUTHORITIES_RECORDS + MAX_ADDITIONAL_RECORDS) * SLAB_PAGE_SIZE)
 
 
 int run_server();
 
 
-struct message *get_message(struct sockaddr_storage *src_addr, char *buffer, ssize_t count);
-void free_message(struct message *message);
+struct message *get_message(struct sockaddr_storage *src_addr, char *buffer, ssize_t count, struct slab *records);
+void free_message(struct message *message, struct slab *records);
 void send_reply(struct sockaddr_storage *src_addr, struct message *message, int fd);
 
 
@@ -56,6 +59,12 @@ int run_server() {
     }
     freeaddrinfo(res);
 
+    struct slab records;
+    if (slab_init(&records, RECORD_SLAB_SIZE) != 0) {
+        fprintf(stderr, "Failed to reserve %d bytes for resource records\n", RECORD_SLAB_SIZE);
+        exit(EXIT_FAILURE);
+    }
+
     printf("Bind finished\n");
     printf("Listening on port 53\n");
 
@@ -77,14 +86,15 @@ int run_server() {
                 printf("%02X ", (char) buffer[i]);
             }
             printf("\n\n");
-            struct message *message = get_message(&src_addr, buffer, count);
+            struct message *message = get_message(&src_addr, buffer, count, &records);
             printf("Message received.\n\n");
             send_reply(&src_addr, message, fd);
             printf("Reply sent.\n\n");
-            free_message(message);
+            free_message(message, &records);
         }
     }
 
+    slab_destroy(&records);
     return EXIT_SUCCESS;
 }
 
@@ -94,9 +104,10 @@ int run_server() {
  * @param src_addr source address of the DNS message
  * @param buffer raw DNS message bytes
  * @param count length of the buffer
+ * @param records slab the resource records are allocated from
  * @return heap allocated message
  */
-struct message *get_message(struct sockaddr_storage *src_addr, char *buffer, ssize_t count) {
+struct message *get_message(struct sockaddr_storage *src_addr, char *buffer, ssize_t count, struct slab *records) {
     char host[NI_MAXHOST];
     getnameinfo((struct sockaddr *) src_addr, src_addr->ss_len, host, sizeof(host), NULL, 0, NI_NUMERICHOST);
     printf("Received %zd bytes from host: %s\n", count, host);
@@ -119,32 +130,35 @@ struct message *get_message(struct sockaddr_storage *src_addr, char *buffer, ssi
     message->questions = questions;
 
 
-    struct resource **answers = malloc(sizeof(struct resource *) * MAX_ANSWERS_RECORDS);
+    struct resource **answers = calloc(MAX_ANSWERS_RECORDS, sizeof(struct resource *));
     for (int i = 0; i < message->header->ancount && i < MAX_ANSWERS_RECORDS; i++) {
-        struct resource *answer = get_resource(buffer + DNS_HEADER_SIZE + DNS_QUESTION_SIZE, count - offset);
+        struct resource *answer = get_resource(buffer, count, &offset, records);
+        if (answer == NULL)
+            break;
         answers[i] = answer;
-        offset += answer->name_len + answer->rdlength + 10;
         print_resource(answer);
     }
     message->answers = answers;
 
 
-    struct resource **authorities = malloc(sizeof(struct resource *) * MAX_AUTHORITIES_RECORDS);
+    struct resource **authorities = calloc(MAX_AUTHORITIES_RECORDS, sizeof(struct resource *));
     for (int i = 0; i < message->header->nscount && i < MAX_AUTHORITIES_RECORDS; i++) {
-        struct resource *authority = get_resource(buffer + offset, count - offset);
-        answers[i] = authority;
-        offset += authority->name_len + authority->rdlength + 10;
+        struct resource *authority = get_resource(buffer, count, &offset, records);
+        if (authority == NULL)
+            break;
+        authorities[i] = authority;
         print_resource(authority);
     }
     message->authorities = authorities;
 
 
-    struct resource **additionals = malloc(sizeof(struct resource *) * MAX_ADDITIONAL_RECORDS);
+    struct resource **additionals = calloc(MAX_ADDITIONAL_RECORDS, sizeof(struct resource *));
     for (int i = 0; i < message->header->arcount && i < MAX_ADDITIONAL_RECORDS; i++) {
-        struct resource *additional = get_resource(buffer + offset, count - offset);
+        struct resource *additional = get_resource(buffer, count, &offset, records);
+        if (additional == NULL)
+            break;
         additionals[i] = additional;
-        offset += additionals[i]->name_len + additionals[i]->rdlength + 10;
-        print_resource(additionals[i]);
+        print_resource(additional);
     }
     message->additionals = additionals;
 
@@ -154,8 +168,9 @@ struct message *get_message(struct sockaddr_storage *src_addr, char *buffer, ssi
 /**
  * Free the message structure
  * @param message DNS message
+ * @param records slab the resource records were allocated from
  */
-void free_message(struct message *message) {
+void free_message(struct message *message, struct slab *records) {
     int arcount = message->header->arcount;
     int nscount = message->header->nscount;
     int ancount = message->header->ancount;
@@ -166,18 +181,15 @@ void free_message(struct message *message) {
     }
     free(message->questions);
     for (int i = 0; i < ancount && i < MAX_ANSWERS_RECORDS; i++) {
-        free(message->answers[i]->rdata);
-        free(message->answers[i]);
+        slab_free(records, message->answers[i]);
     }
     free(message->answers);
     for (int i = 0; i < arcount && i < MAX_ANSWERS_RECORDS; i++) {
-        free(message->additionals[i]->rdata);
-        free(message->additionals[i]);
+        slab_free(records, message->additionals[i]);
     }
     free(message->additionals);
     for (int i = 0; i < nscount && i < MAX_ANSWERS_RECORDS; i++) {
-        free(message->authorities[i]->rdata);
-        free(message->authorities[i]);
+        slab_free(records, message->authorities[i]);
     }
     free(message->authorities);
     free(message->header);
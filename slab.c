@@ -0,0 +1,248 @@
+//
+// Size-classed slab allocator with a hard memory ceiling
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "slab.h"
+
+#define SLAB_ROUND_UP(n, align) (((n) + (align) - 1) & ~((size_t) (align) - 1))
+#define SLAB_PAGE_HEADER_SIZE SLAB_ROUND_UP(sizeof(struct slab_page), SLAB_CHUNK_ALIGN)
+
+/**
+ * Initializes the slab allocator, reserves its pages, and computes its size classes
+ *
+ * Classes grow by roughly 25% so that no allocation wastes more than
+ * about a fifth of its chunk, which keeps internal fragmentation low.
+ * Pages are only touched once handed out, so the operating system backs
+ * the region lazily.
+ *
+ * @param slab allocator to initialize
+ * @param limit maximum number of bytes the allocator may hold in pages, rounded down to whole pages
+ * @return 0 on success, -1 if limit is below one page or the region cannot be reserved
+ */
+int slab_init(struct slab *slab, size_t limit) {
+    memset(slab, 0, sizeof(struct slab));
+    slab->limit = limit / SLAB_PAGE_SIZE * SLAB_PAGE_SIZE;
+    if (slab->limit == 0 || (slab->region = aligned_alloc(SLAB_PAGE_SIZE, slab->limit)) == NULL)
+        return -1;
+    size_t size = SLAB_MIN_CHUNK_SIZE;
+    while (slab->num_classes < SLAB_MAX_CLASSES - 1 && size < SLAB_MAX_CHUNK_SIZE) {
+        slab->classes[slab->num_classes++].chunk_size = size;
+        size = SLAB_ROUND_UP(size + size / 4, SLAB_CHUNK_ALIGN);
+    }
+    slab->classes[slab->num_classes++].chunk_size = SLAB_MAX_CHUNK_SIZE;
+    return 0;
+}
+
+/**
+ * Releases the page region, invalidating every chunk
+ *
+ * @param slab allocator to destroy
+ */
+void slab_destroy(struct slab *slab) {
+    free(slab->region);
+    memset(slab, 0, sizeof(struct slab));
+}
+
+/**
+ * Finds the smallest size class that fits size bytes
+ *
+ * @param slab allocator
+ * @param size requested size
+ * @return index of the class, or num_classes if size is too large
+ */
+size_t slab_class_id(const struct slab *slab, size_t size) {
+    size_t i = 0;
+    while (i < slab->num_classes && slab->classes[i].chunk_size < size)
+        i++;
+    return i;
+}
+
+/**
+ * Size of the chunk that would back an allocation of size bytes
+ *
+ * @param slab allocator
+ * @param size requested size
+ * @return chunk size, or 0 if size is larger than the largest class
+ */
+size_t slab_chunk_size(const struct slab *slab, size_t size) {
+    size_t class_id = slab_class_id(slab, size);
+    return class_id < slab->num_classes ? slab->classes[class_id].chunk_size : 0;
+}
+
+static void slab_unlink(struct slab_class *class, struct slab_page *page) {
+    if (page->prev != NULL)
+        page->prev->next = page->next;
+    else
+        class->partial = page->next;
+    if (page->next != NULL)
+        page->next->prev = page->prev;
+    page->prev = NULL;
+    page->next = NULL;
+}
+
+static void slab_push(struct slab_class *class, struct slab_page *page) {
+    page->prev = NULL;
+    page->next = class->partial;
+    if (class->partial != NULL)
+        class->partial->prev = page;
+    class->partial = page;
+}
+
+/**
+ * Assigns a free page to a class and threads its chunks into a free list
+ *
+ * Emptied pages are reused before pages of the region that were never
+ * touched.
+ *
+ * @param slab allocator
+ * @param class_id class the page will serve
+ * @return page, or NULL if every page of the region is assigned
+ */
+static struct slab_page *slab_grow(struct slab *slab, size_t class_id) {
+    struct slab_page *page = slab->free_pages;
+    if (page != NULL) {
+        slab->free_pages = page->next;
+    } else if (slab->untouched < slab->limit) {
+        page = (struct slab_page *) (slab->region + slab->untouched);
+        slab->untouched += SLAB_PAGE_SIZE;
+    } else {
+        return NULL;
+    }
+    struct slab_class *class = &slab->classes[class_id];
+    memset(page, 0, sizeof(struct slab_page));
+    page->class_id = (uint16_t) class_id;
+    page->capacity = (uint16_t) ((SLAB_PAGE_SIZE - SLAB_PAGE_HEADER_SIZE) / class->chunk_size);
+
+    // Thread the free list back to front so chunks are handed out in address order
+    char *base = (char *) page + SLAB_PAGE_HEADER_SIZE;
+    for (size_t i = page->capacity; i > 0; i--) {
+        void **chunk = (void **) (base + (i - 1) * class->chunk_size);
+        *chunk = page->free_list;
+        page->free_list = chunk;
+    }
+
+    slab->used += SLAB_PAGE_SIZE;
+    class->pages++;
+    slab_push(class, page);
+    return page;
+}
+
+/**
+ * Allocates a chunk large enough for size bytes
+ *
+ * @param slab allocator
+ * @param size requested size
+ * @return chunk, or NULL if size is too large or the memory limit is reached
+ */
+void *slab_alloc(struct slab *slab, size_t size) {
+    size_t class_id = slab_class_id(slab, size);
+    if (class_id >= slab->num_classes)
+        return NULL;
+    struct slab_class *class = &slab->classes[class_id];
+    struct slab_page *page = class->partial;
+    if (page == NULL && (page = slab_grow(slab, class_id)) == NULL)
+        return NULL;
+
+    void **chunk = page->free_list;
+    page->free_list = *chunk;
+    page->in_use++;
+    if (page->free_list == NULL)
+        slab_unlink(class, page);
+    slab->allocated += class->chunk_size;
+    return chunk;
+}
+
+/**
+ * Returns a chunk to its page
+ *
+ * Pages that become empty go on the free page list immediately so
+ * memory freed in one size class can be reused by any other class.
+ *
+ * @param slab allocator
+ * @param ptr chunk returned by slab_alloc
+ */
+void slab_free(struct slab *slab, void *ptr) {
+    if (ptr == NULL)
+        return;
+    struct slab_page *page = (struct slab_page *) ((uintptr_t) ptr & ~((uintptr_t) SLAB_PAGE_SIZE - 1));
+    struct slab_class *class = &slab->classes[page->class_id];
+    int was_full = page->free_list == NULL;
+
+    void **chunk = ptr;
+    *chunk = page->free_list;
+    page->free_list = chunk;
+    page->in_use--;
+    slab->allocated -= class->chunk_size;
+
+    if (page->in_use == 0) {
+        if (!was_full)
+            slab_unlink(class, page);
+        class->pages--;
+        slab->used -= SLAB_PAGE_SIZE;
+        page->next = slab->free_pages;
+        slab->free_pages = page;
+    } else if (was_full) {
+        slab_push(class, page);
+    }
+}
+
+/**
+ * Lists the chunks in use in the page holding ptr
+ *
+ * Freeing the listed chunks releases the page, which lets a caller at
+ * the memory limit move a page from one size class to another.
+ *
+ * @param slab allocator
+ * @param ptr any chunk in the page
+ * @param chunks array of at least SLAB_MAX_PAGE_CHUNKS pointers
+ * @return number of chunks written to chunks
+ */
+size_t slab_page_chunks(const struct slab *slab, const void *ptr, void **chunks) {
+    const struct slab_page *page = (const struct slab_page *) ((uintptr_t) ptr & ~((uintptr_t) SLAB_PAGE_SIZE - 1));
+    size_t chunk_size = slab->classes[page->class_id].chunk_size;
+    char *base = (char *) page + SLAB_PAGE_HEADER_SIZE;
+    uint8_t free_chunks[SLAB_MAX_PAGE_CHUNKS] = {0};
+    for (void **chunk = page->free_list; chunk != NULL; chunk = *chunk)
+        free_chunks[((char *) chunk - base) / chunk_size] = 1;
+
+    size_t count = 0;
+    for (size_t i = 0; i < page->capacity; i++) {
+        if (!free_chunks[i])
+            chunks[count++] = base + i * chunk_size;
+    }
+    return count;
+}
+
+/**
+ * Position of the page holding ptr within the region
+ *
+ * @param slab allocator
+ * @param ptr any chunk handed out by slab_alloc
+ * @return page index, less than limit / SLAB_PAGE_SIZE
+ */
+size_t slab_page_index(const struct slab *slab, const void *ptr) {
+    return (size_t) ((const char *) ptr - slab->region) / SLAB_PAGE_SIZE;
+}
+
+/**
+ * Print slab allocator usage
+ *
+ * @param slab
+ */
+void print_slab(const struct slab *slab) {
+    printf("Slab: {\n"
+           "  limit: %zu,\n"
+           "  used: %zu,\n"
+           "  allocated: %zu,\n"
+           "  classes: [",
+           slab->limit, slab->used, slab->allocated);
+    for (size_t i = 0; i < slab->num_classes; i++) {
+        if (slab->classes[i].pages > 0)
+            printf(" %zu:%zu", slab->classes[i].chunk_size, slab->classes[i].pages);
+    }
+    printf(" ]\n"
+           "}\n");
+}
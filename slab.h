@@ -0,0 +1,70 @@
+//
+// Size-classed slab allocator with a hard memory ceiling
+//
+
+#ifndef PALANTIR_SLAB_H
+#define PALANTIR_SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SLAB_PAGE_SIZE 16384  // must be a power of two, pages are aligned to their size
+#define SLAB_MIN_CHUNK_SIZE 32
+#define SLAB_MAX_CHUNK_SIZE 2048
+#define SLAB_CHUNK_ALIGN 16
+#define SLAB_MAX_CLASSES 32
+#define SLAB_MAX_PAGE_CHUNKS (SLAB_PAGE_SIZE / SLAB_MIN_CHUNK_SIZE)
+
+/**
+ * Page holding chunks of a single size class
+ *
+ * The header lives at the start of the page, so the owning page of
+ * any chunk is found by masking the chunk address with the page size.
+ */
+struct slab_page {
+    struct slab_page *prev;  // previous page of the class with free chunks
+    struct slab_page *next;  // next page of the class with free chunks, or next free page
+    void *free_list;  // singly linked list of free chunks in this page
+    uint16_t class_id;
+    uint16_t in_use;  // chunks currently handed out
+    uint16_t capacity;  // total chunks in the page
+};
+
+struct slab_class {
+    size_t chunk_size;
+    struct slab_page *partial;  // pages with at least one free chunk
+    size_t pages;
+};
+
+/**
+ * Slab allocator
+ *
+ * All page memory is reserved as one aligned region when the allocator
+ * is created, so the limit bounds what the process holds and pages
+ * never churn the system heap. Pages that empty go on a free page list
+ * and are handed to whichever size class needs a page next.
+ */
+struct slab {
+    char *region;  // limit bytes of page aligned memory
+    size_t limit;  // hard ceiling on bytes held in pages, a multiple of SLAB_PAGE_SIZE
+    size_t used;  // bytes of pages assigned to a size class
+    size_t allocated;  // chunk bytes handed out, used / allocated is the page fragmentation ratio
+    size_t untouched;  // offset of the first region page never handed out
+    struct slab_page *free_pages;  // emptied pages ready for reuse
+    size_t num_classes;
+    struct slab_class classes[SLAB_MAX_CLASSES];
+};
+
+int slab_init(struct slab *slab, size_t limit);
+void slab_destroy(struct slab *slab);
+
+void *slab_alloc(struct slab *slab, size_t size);
+void slab_free(struct slab *slab, void *ptr);
+size_t slab_class_id(const struct slab *slab, size_t size);
+size_t slab_chunk_size(const struct slab *slab, size_t size);
+size_t slab_page_chunks(const struct slab *slab, const void *ptr, void **chunks);
+size_t slab_page_index(const struct slab *slab, const void *ptr);
+
+void print_slab(const struct slab *slab);
+
+#endif //PALANTIR_SLAB_H
@@ -0,0 +1,291 @@
+//
+// Tests for the slab allocator and the record cache
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../cache.h"
+#include "../slab.h"
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void) {
+    rng_state = rng_state * 1103515245 + 12345;
+    return rng_state >> 8;
+}
+
+/**
+ * Builds a resource for <label>.example.com. in the caller's buffers
+ */
+static struct resource make_resource(char *name, const char *label, char *rdata, uint16_t rdlength, uint32_t ttl) {
+    size_t label_len = strlen(label);
+    name[0] = (char) label_len;
+    memcpy(name + 1, label, label_len);
+    memcpy(name + 1 + label_len, "\x07" "example" "\x03" "com", 13);  // includes the null label
+    struct resource resource = {
+        .name = name,
+        .name_len = label_len + 14,
+        .type = 1,
+        .class = 1,
+        .ttl = ttl,
+        .rdlength = rdlength,
+        .rdata = rdata,
+    };
+    return resource;
+}
+
+static int cache_insert_one(struct cache *cache, const struct resource *resource, time_t now) {
+    return cache_insert(cache, &resource, 1, now);
+}
+
+static void test_slab_returns_pages(void) {
+    struct slab slab;
+    CHECK(slab_init(&slab, 64 * SLAB_PAGE_SIZE + 1) == 0);
+    CHECK(slab.limit == 64 * SLAB_PAGE_SIZE);
+    void *chunks[4096];
+    size_t count = 0;
+    while (count < 4096 && (chunks[count] = slab_alloc(&slab, 24 + rng() % 1000)) != NULL)
+        count++;
+    CHECK(count > 0);
+    CHECK(slab.used <= slab.limit);
+    CHECK(slab.allocated <= slab.used);
+    CHECK(slab_alloc(&slab, SLAB_MAX_CHUNK_SIZE + 1) == NULL);
+
+    for (size_t i = 0; i < count; i++)
+        slab_free(&slab, chunks[i]);
+    CHECK(slab.used == 0);
+    CHECK(slab.allocated == 0);
+    for (size_t i = 0; i < slab.num_classes; i++)
+        CHECK(slab.classes[i].pages == 0);
+    slab_destroy(&slab);
+}
+
+static void test_slab_reuses_pages(void) {
+    struct slab slab;
+    CHECK(slab_init(&slab, 64 * SLAB_PAGE_SIZE) == 0);
+    void *chunks[1000];
+    for (size_t i = 0; i < 1000; i++)
+        CHECK((chunks[i] = slab_alloc(&slab, 100)) != NULL);
+    size_t untouched = slab.untouched;
+    CHECK(untouched >= 4 * SLAB_PAGE_SIZE);
+    for (size_t i = 0; i < 1000; i++)
+        slab_free(&slab, chunks[i]);
+
+    // Emptied pages move to another size class before the rest of the region is touched
+    for (size_t i = 0; i < 14; i++)
+        CHECK((chunks[i] = slab_alloc(&slab, SLAB_MAX_CHUNK_SIZE)) != NULL);
+    CHECK(slab.untouched == untouched);
+    for (size_t i = 0; i < 14; i++)
+        slab_free(&slab, chunks[i]);
+    CHECK(slab.allocated == 0);
+    slab_destroy(&slab);
+}
+
+static void test_rrset_replace_and_expiry(void) {
+    struct cache cache;
+    CHECK(cache_init(&cache, 1024 * 1024) == 0);
+    char name[DNS_MAX_NAME_SIZE];
+    char other_name[DNS_MAX_NAME_SIZE];
+    char rdata[3][4] = {{10, 0, 0, 1}, {10, 0, 0, 2}, {10, 0, 0, 3}};
+    struct resource first = make_resource(name, "www", rdata[0], 4, 300);
+    struct resource second = make_resource(name, "www", rdata[1], 4, 60);
+    CHECK(cache_insert(&cache, (const struct resource *[]) {&first, &second}, 2, 1000) == 0);
+
+    const struct cache_entry *entry = cache_lookup(&cache, name, first.name_len, 1, 1, 1000);
+    CHECK(entry != NULL);
+    CHECK(entry->rr_count == 2);
+    CHECK(entry->expires == 1060);
+    CHECK(cache_lookup(&cache, name, first.name_len, 28, 1, 1000) == NULL);
+
+    // A new response replaces the RRset and keeps its hit count
+    struct resource third = make_resource(name, "www", rdata[2], 4, 300);
+    CHECK(cache_insert_one(&cache, &third, 1000) == 0);
+    entry = cache_lookup(&cache, name, first.name_len, 1, 1, 1000);
+    CHECK(entry != NULL);
+    CHECK(entry->rr_count == 1);
+    CHECK(entry->freq == 2);
+    CHECK(entry->expires == 1300);
+    CHECK(memcmp(entry->data + entry->name_len, "\x00\x04\x0A\x00\x00\x03", 6) == 0);
+
+    name[1] = 'W';  // names compare case insensitively
+    CHECK(cache_lookup(&cache, name, first.name_len, 1, 1, 1299) != NULL);
+    CHECK(cache_lookup(&cache, name, first.name_len, 1, 1, 1300) == NULL);
+    CHECK(cache.counts[CACHE_QUEUE_SMALL] + cache.counts[CACHE_QUEUE_MAIN] == 0);
+    CHECK(cache.slab.used == 0);
+
+    // Sets that cannot be cached drop the cached RRset
+    struct resource other = make_resource(other_name, "mail", rdata[1], 4, 300);
+    CHECK(cache_insert_one(&cache, &first, 1000) == 0);
+    CHECK(cache_insert(&cache, (const struct resource *[]) {&first, &other}, 2, 1000) == -1);
+    CHECK(cache_lookup(&cache, name, first.name_len, 1, 1, 1000) == NULL);
+    char large[SLAB_MAX_CHUNK_SIZE] = {0};
+    struct resource too_large = make_resource(name, "www", large, sizeof(large), 300);
+    CHECK(cache_insert_one(&cache, &first, 1000) == 0);
+    CHECK(cache_insert_one(&cache, &too_large, 1000) == -1);
+    CHECK(cache_lookup(&cache, name, first.name_len, 1, 1, 1000) == NULL);
+    CHECK(cache.slab.used == 0);
+    cache_destroy(&cache);
+}
+
+static void test_ttl_limits(void) {
+    struct cache cache;
+    CHECK(cache_init(&cache, 1024 * 1024) == 0);
+    char name[DNS_MAX_NAME_SIZE];
+    char rdata[4] = {10, 0, 0, 1};
+    struct resource resource = make_resource(name, "www", rdata, sizeof(rdata), 7 * 86400);
+    CHECK(cache_insert_one(&cache, &resource, 1000) == 0);
+    const struct cache_entry *entry = cache_lookup(&cache, name, resource.name_len, 1, 1, 1000);
+    CHECK(entry != NULL);
+    CHECK(entry->expires == 1000 + CACHE_MAX_TTL);
+
+    // TTLs with the high bit set are 0, and RRsets with a TTL of 0 are not cached
+    resource.ttl = 0x80000000;
+    CHECK(cache_insert_one(&cache, &resource, 1000) == 0);
+    CHECK(cache_lookup(&cache, name, resource.name_len, 1, 1, 1000) == NULL);
+    resource.ttl = 0;
+    CHECK(cache_insert_one(&cache, &resource, 1000) == 0);
+    CHECK(cache_lookup(&cache, name, resource.name_len, 1, 1, 1000) == NULL);
+    CHECK(cache.slab.used == 0);
+    cache_destroy(&cache);
+}
+
+static void test_flood_never_reaches_main(void) {
+    struct cache cache;
+    CHECK(cache_init(&cache, 1024 * 1024) == 0);
+    char name[DNS_MAX_NAME_SIZE];
+    char label[DNS_MAX_LABEL_SIZE];
+    char rdata[64] = {0};
+
+#define HOT_NAMES 500
+    for (int i = 0; i < HOT_NAMES; i++) {
+        snprintf(label, sizeof(label), "hot%d", i);
+        struct resource resource = make_resource(name, label, rdata, 16, 300);
+        CHECK(cache_insert_one(&cache, &resource, 0) == 0);
+        CHECK(cache_lookup(&cache, name, resource.name_len, 1, 1, 0) != NULL);
+    }
+
+    for (int i = 0; i < 200000; i++) {
+        snprintf(label, sizeof(label), "flood%08x%d", rng(), i);
+        struct resource resource = make_resource(name, label, rdata, (uint16_t) (4 + i % 60), 300);
+        CHECK(cache_insert_one(&cache, &resource, 0) == 0);
+        CHECK(cache.slab.used <= cache.slab.limit);
+        CHECK(cache.counts[CACHE_QUEUE_MAIN] <= HOT_NAMES);
+        if (i % 100 == 0) {
+            snprintf(label, sizeof(label), "hot%d", i / 100 % HOT_NAMES);
+            resource = make_resource(name, label, rdata, 16, 300);
+            CHECK(cache_lookup(&cache, name, resource.name_len, 1, 1, 0) != NULL);
+        }
+    }
+    CHECK(cache.evictions > 0);
+
+    for (int i = 0; i < HOT_NAMES; i++) {
+        snprintf(label, sizeof(label), "hot%d", i);
+        struct resource resource = make_resource(name, label, rdata, 16, 300);
+        CHECK(cache_lookup(&cache, name, resource.name_len, 1, 1, 0) != NULL);
+    }
+#undef HOT_NAMES
+    cache_destroy(&cache);
+}
+
+/**
+ * A flood confined to one size class must not take pages from the
+ * working set held in another class
+ */
+static void check_flood_in_other_class(uint16_t hot_rdlength, uint16_t flood_rdlength, const char *flood_prefix) {
+    struct cache cache;
+    CHECK(cache_init(&cache, 1024 * 1024) == 0);
+    char name[DNS_MAX_NAME_SIZE];
+    char label[DNS_MAX_LABEL_SIZE];
+    char rdata[1024] = {0};
+
+#define HOT_NAMES 500
+    for (int i = 0; i < HOT_NAMES; i++) {
+        snprintf(label, sizeof(label), "hot%d", i);
+        struct resource resource = make_resource(name, label, rdata, hot_rdlength, 300);
+        CHECK(cache_insert_one(&cache, &resource, 0) == 0);
+        CHECK(cache_lookup(&cache, name, resource.name_len, 1, 1, 0) != NULL);
+    }
+    size_t hot_class = cache.slab.num_classes;
+    for (size_t i = 0; i < cache.slab.num_classes; i++) {
+        if (cache.slab.classes[i].pages > 0)
+            hot_class = i;
+    }
+
+    for (int i = 0; i < 100000; i++) {
+        snprintf(label, sizeof(label), "%s%08x%d", flood_prefix, rng(), i);
+        struct resource resource = make_resource(name, label, rdata, flood_rdlength, 300);
+        CHECK(slab_class_id(&cache.slab, sizeof(struct cache_entry) + resource.name_len + flood_rdlength + 2) !=
+              hot_class);
+        CHECK(cache_insert_one(&cache, &resource, 0) == 0);
+        CHECK(cache.slab.used <= cache.slab.limit);
+        if (i % 100 == 0) {
+            snprintf(label, sizeof(label), "hot%d", i / 100 % HOT_NAMES);
+            resource = make_resource(name, label, rdata, hot_rdlength, 300);
+            CHECK(cache_lookup(&cache, name, resource.name_len, 1, 1, 0) != NULL);
+        }
+    }
+    CHECK(cache.evictions > 0);
+
+    for (int i = 0; i < HOT_NAMES; i++) {
+        snprintf(label, sizeof(label), "hot%d", i);
+        struct resource resource = make_resource(name, label, rdata, hot_rdlength, 300);
+        CHECK(cache_lookup(&cache, name, resource.name_len, 1, 1, 0) != NULL);
+    }
+#undef HOT_NAMES
+    cache_destroy(&cache);
+}
+
+static void test_flood_in_other_class(void) {
+    check_flood_in_other_class(16, 600, "flood");
+    check_flood_in_other_class(16, 16, "flood-with-a-much-longer-label-");
+    check_flood_in_other_class(600, 16, "flood");
+}
+
+/**
+ * After random churn every page holds entries of mixed ages, inserting
+ * into an unused size class must still evict at most one page of entries
+ */
+static void test_eviction_bounded_by_page(void) {
+    struct cache cache;
+    CHECK(cache_init(&cache, 4 * 1024 * 1024) == 0);
+    char name[DNS_MAX_NAME_SIZE];
+    char label[DNS_MAX_LABEL_SIZE];
+    char rdata[900] = {0};
+
+    for (int i = 0; i < 400000; i++) {
+        snprintf(label, sizeof(label), "churn%u", rng() % 100000);
+        struct resource resource = make_resource(name, label, rdata, 4, 300);
+        CHECK(cache_insert_one(&cache, &resource, 0) == 0);
+        CHECK(cache.slab.used <= cache.slab.limit);
+    }
+    size_t entries = cache.counts[CACHE_QUEUE_SMALL] + cache.counts[CACHE_QUEUE_MAIN];
+    CHECK(cache.slab.used + SLAB_PAGE_SIZE > cache.slab.limit);
+
+    uint64_t evictions = cache.evictions;
+    struct resource resource = make_resource(name, "large", rdata, sizeof(rdata), 300);
+    CHECK(cache_insert_one(&cache, &resource, 0) == 0);
+    CHECK(cache.evictions - evictions <= SLAB_MAX_PAGE_CHUNKS);
+    CHECK(cache.counts[CACHE_QUEUE_SMALL] + cache.counts[CACHE_QUEUE_MAIN] + SLAB_MAX_PAGE_CHUNKS >= entries);
+    CHECK(cache.slab.used <= cache.slab.limit);
+    cache_destroy(&cache);
+}
+
+int main() {
+    test_slab_returns_pages();
+    test_slab_reuses_pages();
+    test_rrset_replace_and_expiry();
+    test_ttl_limits();
+    test_flood_never_reaches_main();
+    test_flood_in_other_class();
+    test_eviction_bounded_by_page();
+    printf("cache_test passed\n");
+    return EXIT_SUCCESS;
+}